@@ -0,0 +1,1223 @@
+#ifndef MMAPGETSET_H
+#define MMAPGETSET_H
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+//
+// file helpers
+//
+
+inline size_t getFilesize(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+    return st.st_size;
+}
+
+// spin until file is unlocked, and take lock for yourself
+inline bool lockFile(int fd, int operation) {
+    while(true) {
+        int gotLock = flock(fd, operation);
+        if (gotLock == 0) return true;
+        if (errno != EINTR) return false;
+    }
+}
+
+inline void unlockFile(int fd) {
+    flock(fd, LOCK_UN);
+}
+
+// flush data written through fd to disk, edits made through a mapping
+// need msync first
+inline bool flushFile(int fd) {
+#ifdef __APPLE__
+    int rc = fcntl(fd, F_FULLFSYNC);
+#else
+    int rc = fdatasync(fd);
+#endif
+    return rc == 0;
+}
+
+//
+// asynchronous appends
+//
+
+// how far a record has to get before a setter reports it as stored
+enum class Durability {
+    queued,     // sitting in the writer's ring buffer
+    written,    // written to the file, may still be in the page cache
+    synced      // flushed to the disk
+};
+
+inline bool parseDurability(const char* name, Durability& level) {
+    if (std::strcmp(name, "queued") == 0) level = Durability::queued;
+    else if (std::strcmp(name, "written") == 0) level = Durability::written;
+    else if (std::strcmp(name, "synced") == 0) level = Durability::synced;
+    else return false;
+    return true;
+}
+
+// capacity of a writer's ring buffer, and so of an engine's pending keys
+const size_t kWriterCapacity = 256;
+
+// Appends records to the end of a file from a dedicated writer thread.
+//
+// Setters queue records into a fixed ring buffer and return as soon as the
+// requested durability level is reached. The writer thread drains whatever
+// has accumulated since its last pass, appends it with a single writev under
+// one exclusive flock, and issues one flush for the whole batch if any
+// request in it asked for one. If a batch fails, the writer records why and
+// every later request is refused.
+//
+// A setter decides to append a key after finding it absent at some file
+// size, but another process may append the same key before the writer gets
+// the lock. So under the lock the writer searches whatever was appended
+// since that size, and overwrites the key there instead of appending it
+// twice. Format is the record layout, see below.
+template <typename Format>
+class AsyncWriter {
+public:
+    typedef typename Format::KeyType Key;
+    typedef typename Format::ValueType Value;
+
+    static constexpr size_t kCapacity = kWriterCapacity;
+
+    AsyncWriter() = default;
+
+    ~AsyncWriter() {
+        if (fd < 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        notEmpty.notify_one();
+        thread.join();
+        close(fd);
+    }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // open the file for appending and start the writer thread
+    bool open(const char* filename) {
+        fd = ::open(filename, O_RDWR|O_APPEND);
+        if (fd < 0) {
+            failure = "file could not be opened for writing";
+            return false;
+        }
+        thread = std::thread(&AsyncWriter::run, this);
+        return true;
+    }
+
+    // queue key and value to be appended, checkedSize being the file size
+    // at which key was found to be absent, returns false if the writer has
+    // failed
+    bool append(Key key, Value value, size_t checkedSize, Durability level) {
+        uint64_t ticket = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            // apply back pressure once the ring buffer is full
+            notFull.wait(lock, [&] { return tail - head < kCapacity || failure != nullptr; });
+            if (failure != nullptr) return false;
+
+            Request& request = ring[tail % kCapacity];
+            request.key = key;
+            request.value = value;
+            request.checkedSize = checkedSize;
+            request.sync = (level == Durability::synced);
+
+            ticket = tail++;
+            notEmpty.notify_one();
+        }
+        return wait(ticket, level);
+    }
+
+    // block until every queued request has been handled, returns false if
+    // the writer has failed
+    bool drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [&] { return head == tail; });
+        return failure == nullptr;
+    }
+
+    // why the writer failed, or nullptr
+    const char* error() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failure;
+    }
+
+private:
+    struct Request {
+        Key key;
+        Value value;
+        size_t checkedSize;
+        bool sync;
+        size_t length;
+        char record[Format::kMaxRecord];
+    };
+
+    bool wait(uint64_t ticket, Durability level) {
+        if (level == Durability::queued) return true;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t& reached = (level == Durability::written) ? written : synced;
+        completed.wait(lock, [&] { return reached > ticket || failure != nullptr; });
+        return reached > ticket;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            notEmpty.wait(lock, [&] { return head != tail || stopping; });
+            if (head == tail) return;
+
+            // slots in [first, last) are not reused until head moves past them,
+            // so they can be read without holding the mutex
+            const uint64_t first = head;
+            const uint64_t last = tail;
+            lock.unlock();
+
+            bool needSync = false;
+            for (uint64_t ticket = first; ticket != last; ++ticket)
+                needSync = needSync || ring[ticket % kCapacity].sync;
+
+            const char* error = nullptr;
+            if (lockFile(fd, LOCK_EX)) {
+                error = writeBatch(first, last, needSync);
+                unlockFile(fd);
+            } else {
+                error = "could not lock file";
+            }
+
+            // flush once for every request in the batch, outside the file lock
+            if (error == nullptr && needSync && !flushFile(fd))
+                error = "could not flush file";
+
+            lock.lock();
+            head = last;
+            if (error == nullptr) {
+                written = last;
+                if (needSync) synced = last;
+            } else {
+                failure = error;
+            }
+            completed.notify_all();
+            notFull.notify_all();
+        }
+    }
+
+    // with the file locked, overwrite keys that were appended by someone
+    // else since they were checked and append the rest in one writev
+    const char* writeBatch(uint64_t first, uint64_t last, bool needSync) {
+        const size_t size = getFilesize(fd);
+
+        size_t oldest = size;
+        for (uint64_t ticket = first; ticket != last; ++ticket)
+            oldest = std::min(oldest, ring[ticket % kCapacity].checkedSize);
+
+        // the file grew since the oldest check, map it to look for keys
+        char* mapped = nullptr;
+        if (oldest < size) {
+            void* region = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            if (region == MAP_FAILED) return "could not memory map file";
+            mapped = static_cast<char*>(region);
+            format.remapped(mapped, size, false);
+        }
+
+        int count = 0;
+        size_t total = 0;
+        bool overwrote = false;
+        for (uint64_t ticket = first; ticket != last; ++ticket) {
+            Request& request = ring[ticket % kCapacity];
+
+            if (request.checkedSize < size) {
+                char* slot = format.findAppended(mapped, size, request.checkedSize, request.key);
+                if (slot != nullptr) {
+                    Format::store(slot, request.value);
+                    overwrote = true;
+                    continue;
+                }
+            }
+
+            request.length = Format::encode(request.key, request.value, request.record);
+            iov[count].iov_base = request.record;
+            iov[count].iov_len = request.length;
+            total += request.length;
+            count++;
+        }
+
+        const char* error = nullptr;
+        if (overwrote && needSync && msync(mapped, size, MS_SYNC) != 0)
+            error = "could not sync memory";
+        if (mapped != nullptr) munmap(mapped, size);
+        if (error != nullptr) return error;
+
+        // append the whole batch at once
+        if (count != 0) {
+            ssize_t rc = writev(fd, iov, count);
+            if (rc < 0 || static_cast<size_t>(rc) != total) return "could not append to file";
+        }
+        return nullptr;
+    }
+
+    int fd = -1;
+    Format format;
+    Request ring[kCapacity];
+    struct iovec iov[kCapacity];
+
+    uint64_t head = 0;      // oldest ticket the writer has not finished
+    uint64_t tail = 0;      // next ticket to hand out
+    uint64_t written = 0;   // tickets below this have been written
+    uint64_t synced = 0;    // tickets below this have been flushed
+    bool stopping = false;
+    const char* failure = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::condition_variable completed;
+    std::thread thread;
+};
+
+//
+// presence filter
+//
+
+// Sidecar file "<filename>.presence" recording which keys have been stored.
+//
+// Keys of up to 16 bits get one bit each. Wider keys share a blocked Bloom
+// filter in which every key sets one bit in each of the eight words of a
+// single 64 byte block, so a lookup touches one cache line either way.
+//
+// Setters set a key's bits before the key is written to the data file and
+// never clear them, so a clear bit means the key is absent and a getter can
+// answer without locking or searching the data file. The bits are shared
+// between processes through a MAP_SHARED mapping and updated atomically.
+//
+// The sidecar can be deleted and rebuilt while engines have the old one
+// mapped. Engines check with isCurrent() that the path still names the
+// mapped file whenever the data file changes size and every so many
+// misses, rather than on every lookup.
+template <unsigned KeyBits>
+class PresenceFilter {
+public:
+    static constexpr bool kExact = KeyBits <= 16;
+    static constexpr size_t kBlocks = size_t(1) << 14;
+    static constexpr size_t kBytes = kExact ? ((size_t(1) << KeyBits) + 63) / 64 * 8 : kBlocks * 64;
+
+    PresenceFilter() = default;
+    PresenceFilter(const PresenceFilter&) = delete;
+    PresenceFilter& operator=(const PresenceFilter&) = delete;
+
+    ~PresenceFilter() {
+        close();
+    }
+
+    // remember where the sidecar of filename lives, call before opening
+    void setDataFile(const char* filename) {
+        path = std::string(filename) + ".presence";
+    }
+
+    // map an existing sidecar read only, returns false if there is none yet
+    bool openForReading() {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        bool mapped = getFilesize(fd) == kBytes && map(fd, PROT_READ);
+        ::close(fd);
+        return mapped;
+    }
+
+    // map the sidecar for writing and mark every key passed to fill,
+    // creating the sidecar if it does not exist yet
+    template <typename Fill>
+    bool openForWriting(Fill fill) {
+
+        // usually another setter has published one already
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd >= 0) return join(fd, fill);
+        if (errno != ENOENT) return false;
+
+        // build a new sidecar under a private name and only publish it
+        // once it is filled, so getters never see it half built
+        std::string scratch = path + "." + std::to_string(getpid());
+        fd = open(scratch.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, kBytes) != 0 || !map(fd, PROT_READ|PROT_WRITE)) {
+            unlink(scratch.c_str());
+            ::close(fd);
+            return false;
+        }
+        fill(*this);
+
+        int rc = link(scratch.c_str(), path.c_str());
+        int linkError = errno;
+        unlink(scratch.c_str());
+        ::close(fd);
+        if (rc == 0) return true;
+
+        // another setter published one first, add our keys to it instead
+        close();
+        if (linkError != EEXIST) return false;
+
+        fd = open(path.c_str(), O_RDWR);
+        if (fd < 0) return false;
+        return join(fd, fill);
+    }
+
+    void close() {
+        if (words != nullptr) munmap(words, kBytes);
+        words = nullptr;
+    }
+
+    // whether the sidecar path still names the file we have mapped
+    bool isCurrent() const {
+        struct stat st;
+        if (words == nullptr || stat(path.c_str(), &st) != 0) return false;
+        return st.st_dev == device && st.st_ino == inode;
+    }
+
+    bool isOpen() const {
+        return words != nullptr;
+    }
+
+    void insert(uint64_t key) {
+        if constexpr (kExact) {
+            __atomic_fetch_or(&words[key >> 6], uint64_t(1) << (key & 63), __ATOMIC_RELEASE);
+        } else {
+            uint64_t hash = mix(key);
+            uint64_t* block = &words[8 * (hash & (kBlocks - 1))];
+            for (int i = 0; i < 8; ++i)
+                __atomic_fetch_or(&block[i], bitInWord(hash >> 32, i), __ATOMIC_RELEASE);
+        }
+    }
+
+    bool mayContain(uint64_t key) const {
+        if constexpr (kExact) {
+            uint64_t word = __atomic_load_n(&words[key >> 6], __ATOMIC_ACQUIRE);
+            return (word >> (key & 63)) & 1;
+        } else {
+            uint64_t hash = mix(key);
+            const uint64_t* block = &words[8 * (hash & (kBlocks - 1))];
+            for (int i = 0; i < 8; ++i) {
+                uint64_t bit = bitInWord(hash >> 32, i);
+                if ((__atomic_load_n(&block[i], __ATOMIC_ACQUIRE) & bit) == 0) return false;
+            }
+            return true;
+        }
+    }
+
+private:
+    // splitmix64 finalizer, the low bits pick the block and the high bits
+    // pick a bit in each of its words
+    static uint64_t mix(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key;
+    }
+
+    static uint64_t bitInWord(uint64_t hash, int i) {
+        static const uint32_t salt[8] = {
+            0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+        uint32_t position = (static_cast<uint32_t>(hash) * salt[i]) >> 26;
+        return uint64_t(1) << position;
+    }
+
+    // map a published sidecar for writing and mark every key passed to
+    // fill, closes fd
+    template <typename Fill>
+    bool join(int fd, Fill fill) {
+        bool mapped = getFilesize(fd) == kBytes && map(fd, PROT_READ|PROT_WRITE);
+        ::close(fd);
+        if (mapped) fill(*this);
+        return mapped;
+    }
+
+    bool map(int fd, int protection) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) return false;
+
+        void* mapped = mmap(NULL, kBytes, protection, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+
+        words = static_cast<uint64_t*>(mapped);
+        device = st.st_dev;
+        inode = st.st_ino;
+        return true;
+    }
+
+    std::string path;
+    uint64_t* words = nullptr;
+    dev_t device = 0;
+    ino_t inode = 0;
+};
+
+//
+// pending keys
+//
+
+// Keys an engine has queued that its writer has not written yet. A fixed
+// open addressed table holds as many keys as the writer's ring buffer, so
+// it never allocates and clearing it only touches the slots in use.
+template <typename Key>
+class PendingKeys {
+public:
+    static constexpr size_t kCapacity = kWriterCapacity;
+
+    bool isFull() const {
+        return count == kCapacity;
+    }
+
+    bool contains(Key key) const {
+        if (count == 0) return false;
+        for (size_t slot = home(key); used[slot]; slot = (slot + 1) % kSlots)
+            if (keys[slot] == key) return true;
+        return false;
+    }
+
+    void insert(Key key) {
+        size_t slot = home(key);
+        for (; used[slot]; slot = (slot + 1) % kSlots)
+            if (keys[slot] == key) return;
+        used[slot] = true;
+        keys[slot] = key;
+        order[count++] = static_cast<uint16_t>(slot);
+    }
+
+    void clear() {
+        for (size_t i = 0; i < count; ++i)
+            used[order[i]] = false;
+        count = 0;
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < count; ++i)
+            f(keys[order[i]]);
+    }
+
+private:
+    static constexpr int kSlotBits = 9;
+    static constexpr size_t kSlots = size_t(1) << kSlotBits;
+    static_assert(kSlots >= 2 * kCapacity, "pending key table is too small");
+
+    static size_t home(Key key) {
+        return (static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ULL) >> (64 - kSlotBits);
+    }
+
+    Key keys[kSlots];
+    bool used[kSlots] = {};
+    uint16_t order[kCapacity];
+    size_t count = 0;
+};
+
+//
+// record layouts
+//
+// A layout describes how records sit in the data file. Every engine holds
+// its own layout object, which may keep state about the mapped file:
+// remapped() is called each time the file is mapped again, with writable
+// set for engines that set keys, and tidy() is called with the file locked
+// exclusively before each set and returns true if it moved records. find
+// returns a pointer to the kValueBytes bytes holding a key's value, or
+// nullptr.
+//
+// Layouts that append new records hand them to the writer, which encodes
+// them and looks with findAppended for keys added since they were checked;
+// the others make room for a key in place with grownSize and insert while
+// the file is locked.
+//
+
+// "key value\n" lines in insertion order, values padded with spaces to a
+// fixed width so they can be overwritten in place. Engines that set keys
+// index the offset of every key's value, so a set does not scan the file.
+template <typename Key, typename Value>
+class TextLayout {
+public:
+    typedef Key KeyType;
+    typedef Value ValueType;
+
+    static constexpr bool kAppends = true;
+    static constexpr int kKeyWidth = std::numeric_limits<Key>::digits10 + 1;
+    static constexpr int kWidth = std::numeric_limits<Value>::digits10 + 1;
+    static constexpr size_t kValueBytes = kWidth;
+    static constexpr size_t kMaxRecord = kKeyWidth + kWidth + 2;
+
+    static_assert(std::is_unsigned<Key>::value && std::is_unsigned<Value>::value,
+        "text layout stores unsigned integers");
+
+    static void prepare(char*, size_t) {}
+
+    // index the lines added since the last call
+    void remapped(char* data, size_t size, bool writable) {
+        indexing = writable;
+        if (!writable) return;
+
+        // the file was truncated or replaced, start over
+        if (size < indexed) {
+            offsets.clear();
+            indexed = 0;
+        }
+
+        char* end = scan(data + indexed, size - indexed, [&](Key lineKey, char* value) {
+            offsets.emplace(lineKey, value - data);
+            return false;
+        });
+        indexed = end - data;
+    }
+
+    bool tidy(char*, size_t) { return false; }
+
+    char* find(char* data, size_t size, Key key) const {
+        if (indexing) {
+            auto found = offsets.find(key);
+            return (found == offsets.end()) ? nullptr : data + found->second;
+        }
+        return findFrom(data, 0, size, key);
+    }
+
+    // lines never move, so only those after checkedSize need searching
+    char* findAppended(char* data, size_t size, size_t checkedSize, Key key) const {
+        return findFrom(data, checkedSize, size, key);
+    }
+
+    template <typename F>
+    static void forEachKey(char* data, size_t size, F f) {
+        scan(data, size, [&](Key lineKey, char*) {
+            f(lineKey);
+            return false;
+        });
+    }
+
+    static Value load(const char* slot) {
+        Value value = 0;
+        parse(slot, slot + kWidth, value);
+        return value;
+    }
+
+    static void store(char* slot, Value value) {
+        int length = format(value, slot);
+        std::memset(slot + length, ' ', kWidth - length);
+    }
+
+    static size_t encode(Key key, Value value, char* record) {
+        int length = format(key, record);
+        record[length++] = ' ';
+        store(record + length, value);
+        length += kWidth;
+        record[length++] = '\n';
+        return length;
+    }
+
+private:
+    static char* findFrom(char* data, size_t start, size_t size, Key key) {
+        char* found = nullptr;
+        scan(data + start, size - start, [&](Key lineKey, char* value) {
+            if (lineKey == key) found = value;
+            return found != nullptr;
+        });
+        return found;
+    }
+
+    // call visit with the key and value of every line until it returns
+    // true, returns the end of the last complete line visited
+    template <typename F>
+    static char* scan(char* data, size_t size, F visit) {
+        char* const endOfFile = data + size;
+        char* line = data;
+        while (line < endOfFile) {
+            char* newline = static_cast<char*>(memchr(line, '\n', endOfFile - line));
+            if (newline == nullptr) break;
+
+            Key key = 0;
+            char* space = const_cast<char*>(parse(line, newline, key));
+            if (space != line && space < newline && *space == ' ' && visit(key, space + 1))
+                return newline + 1;
+
+            line = newline + 1;
+        }
+        return line;
+    }
+
+    template <typename Number>
+    static const char* parse(const char* digit, const char* end, Number& number) {
+        while (digit < end && *digit >= '0' && *digit <= '9')
+            number = number * 10 + (*digit++ - '0');
+        return digit;
+    }
+
+    template <typename Number>
+    static int format(Number number, char* out) {
+        char reversed[std::numeric_limits<Number>::digits10 + 1];
+        int length = 0;
+        do {
+            reversed[length++] = '0' + number % 10;
+            number /= 10;
+        } while (number != 0);
+        for (int i = 0; i < length; ++i)
+            out[i] = reversed[length - 1 - i];
+        return length;
+    }
+
+    std::unordered_map<Key, size_t> offsets;    // key to offset of its value
+    size_t indexed = 0;                         // bytes of the file in offsets
+    bool indexing = false;
+};
+
+// fixed size key value records, a body sorted by key followed by a short
+// tail of recent appends. Lookups binary search the longest sorted prefix
+// seen so far and scan what follows it. A setter merges the tail into the
+// body once it grows past kMaxTail records. The prefix stays sorted through
+// merges by other processes, so a stale one still finds every key.
+template <typename Key, typename Value>
+class SortedBinaryLayout {
+public:
+    typedef Key KeyType;
+    typedef Value ValueType;
+
+    struct Record {
+        Key key;
+        Value value;
+    };
+
+    static constexpr bool kAppends = true;
+    static constexpr size_t kValueBytes = sizeof(Value);
+    static constexpr size_t kMaxRecord = sizeof(Record);
+    static constexpr size_t kMaxTail = 64;
+
+    // sort records left unsorted by older setters
+    static void prepare(char* data, size_t size) {
+        Record* const begin = reinterpret_cast<Record*>(data);
+        Record* const end = begin + size / sizeof(Record);
+        if (!std::is_sorted(begin, end, byKey))
+            std::sort(begin, end, byKey);
+    }
+
+    // extend the sorted prefix over records added since the last call
+    void remapped(char* data, size_t size, bool) {
+        const Record* const records = reinterpret_cast<const Record*>(data);
+        const size_t count = size / sizeof(Record);
+
+        // the file was truncated or replaced, start over
+        if (sorted > count) sorted = 0;
+
+        if (sorted == 0 && count != 0) sorted = 1;
+        while (sorted < count && records[sorted - 1].key < records[sorted].key)
+            sorted++;
+    }
+
+    // merge a long tail into the body, the file is locked exclusively,
+    // returns true if records moved
+    bool tidy(char* data, size_t size) {
+        Record* const records = reinterpret_cast<Record*>(data);
+        const size_t count = size / sizeof(Record);
+        if (count - sorted <= kMaxTail) return false;
+
+        // merge from the back through a fixed buffer, a chunk at a time
+        Record buffer[kMergeChunk];
+        while (sorted < count) {
+            size_t chunk = std::min(kMergeChunk, count - sorted);
+            std::memcpy(buffer, records + sorted, chunk * sizeof(Record));
+            std::sort(buffer, buffer + chunk, byKey);
+
+            size_t body = sorted;
+            size_t next = sorted + chunk;
+            while (chunk != 0) {
+                if (body != 0 && records[body - 1].key > buffer[chunk - 1].key)
+                    records[--next] = records[--body];
+                else
+                    records[--next] = buffer[--chunk];
+            }
+            sorted += std::min(kMergeChunk, count - sorted);
+        }
+        return true;
+    }
+
+    char* find(char* data, size_t size, Key key) const {
+        Record* const begin = reinterpret_cast<Record*>(data);
+        Record* const end = begin + size / sizeof(Record);
+        Record* const body = begin + std::min(sorted, size / sizeof(Record));
+
+        Record* record = std::lower_bound(begin, body, key,
+            [](const Record& r, Key k) { return r.key < k; });
+        if (record != body && record->key == key)
+            return reinterpret_cast<char*>(&record->value);
+
+        for (record = body; record != end; ++record)
+            if (record->key == key) return reinterpret_cast<char*>(&record->value);
+        return nullptr;
+    }
+
+    // a merge by another setter may have moved records appended since the
+    // check below checkedSize, so the whole file is searched
+    char* findAppended(char* data, size_t size, size_t, Key key) const {
+        return find(data, size, key);
+    }
+
+    template <typename F>
+    static void forEachKey(char* data, size_t size, F f) {
+        const Record* const records = reinterpret_cast<const Record*>(data);
+        for (size_t i = 0; i < size / sizeof(Record); ++i)
+            f(records[i].key);
+    }
+
+    static Value load(const char* slot) {
+        Value value;
+        std::memcpy(&value, slot, sizeof(Value));
+        return value;
+    }
+
+    static void store(char* slot, Value value) {
+        std::memcpy(slot, &value, sizeof(Value));
+    }
+
+    static size_t encode(Key key, Value value, char* record) {
+        Record r;
+        std::memset(&r, 0, sizeof(Record));
+        r.key = key;
+        r.value = value;
+        std::memcpy(record, &r, sizeof(Record));
+        return sizeof(Record);
+    }
+
+private:
+    static constexpr size_t kMergeChunk = 256;
+
+    static bool byKey(const Record& a, const Record& b) {
+        return a.key < b.key;
+    }
+
+    size_t sorted = 0;      // records known to be in order from the start
+};
+
+// one slot per possible key, found by offset without searching
+template <typename Key, typename Value>
+class DirectLayout {
+public:
+    typedef Key KeyType;
+    typedef Value ValueType;
+
+    static constexpr bool kAppends = false;
+
+    static_assert(sizeof(Key) <= 2, "direct layout holds a slot for every possible key");
+
+    struct Slot {
+        Value value;
+        uint8_t present;
+    };
+
+    static constexpr size_t kValueBytes = sizeof(Value);
+
+    static void prepare(char*, size_t) {}
+    void remapped(char*, size_t, bool) {}
+    bool tidy(char*, size_t) { return false; }
+
+    char* find(char* data, size_t size, Key key) const {
+        size_t offset = static_cast<size_t>(key) * sizeof(Slot);
+        if (offset + sizeof(Slot) > size) return nullptr;
+        Slot* slot = reinterpret_cast<Slot*>(data + offset);
+        return slot->present ? reinterpret_cast<char*>(&slot->value) : nullptr;
+    }
+
+    template <typename F>
+    static void forEachKey(char* data, size_t size, F f) {
+        const Slot* const slots = reinterpret_cast<const Slot*>(data);
+        for (size_t i = 0; i < size / sizeof(Slot); ++i)
+            if (slots[i].present) f(static_cast<Key>(i));
+    }
+
+    static size_t grownSize(size_t size, Key key) {
+        return std::max(size, (static_cast<size_t>(key) + 1) * sizeof(Slot));
+    }
+
+    static char* insert(char* data, size_t, Key key) {
+        Slot* slot = reinterpret_cast<Slot*>(data + static_cast<size_t>(key) * sizeof(Slot));
+        slot->present = 1;
+        return reinterpret_cast<char*>(&slot->value);
+    }
+
+    static Value load(const char* slot) {
+        Value value;
+        std::memcpy(&value, slot, sizeof(Value));
+        return value;
+    }
+
+    static void store(char* slot, Value value) {
+        std::memcpy(slot, &value, sizeof(Value));
+    }
+};
+
+//
+// engine
+//
+
+enum class Access {
+    readOnly,
+    readWrite
+};
+
+// outcome of a single lookup
+enum class Lookup {
+    found,
+    missing,
+    failed
+};
+
+// Key value store in a memory mapped file, shared with other processes
+// through flock.
+//
+// KeyBits bounds the keys that can be stored and sizes the presence filter.
+// get, mget and overwriting set do not allocate. Nothing here exits the
+// process: failures are returned, and error() says what went wrong. An
+// engine is meant to be used from a single thread; give each thread its own.
+template <typename Key, typename Value,
+          template <typename, typename> class Layout,
+          unsigned KeyBits = 8 * sizeof(Key)>
+class MmapEngine {
+public:
+    typedef Layout<Key, Value> Format;
+
+    static_assert(std::is_unsigned<Key>::value, "keys are unsigned integers");
+    static_assert(KeyBits <= 8 * sizeof(Key), "key type is too narrow for KeyBits");
+
+    MmapEngine() = default;
+
+    ~MmapEngine() {
+        writer.reset();
+        if (data != nullptr) munmap(data, mappedSize);
+        if (fd >= 0) close(fd);
+    }
+
+    MmapEngine(const MmapEngine&) = delete;
+    MmapEngine& operator=(const MmapEngine&) = delete;
+
+    // open filename, returns false if the engine cannot be used
+    bool open(const char* filename, Access access,
+              Durability durability = Durability::written) {
+        this->access = access;
+        this->durability = durability;
+
+        fd = ::open(filename, access == Access::readWrite ? O_RDWR : O_RDONLY);
+        if (fd < 0) return fail("file could not be opened");
+
+        filter.setDataFile(filename);
+        if (access == Access::readOnly) {
+            filter.openForReading();
+            return true;
+        }
+
+        if (!lockFile(fd, LOCK_EX)) return fail("could not lock file");
+        bool opened = refresh();
+        if (opened) {
+            Format::prepare(data, mappedSize);
+            format.remapped(data, mappedSize, true);
+            opened = loadFilter();
+        }
+        unlockFile(fd);
+        if (!opened) return false;
+
+        if constexpr (Format::kAppends) {
+            writer.reset(new Writer());
+            if (!writer->open(filename)) return fail(writer->error());
+        }
+        return true;
+    }
+
+    // what the last failed call ran into
+    const char* error() const {
+        return lastError;
+    }
+
+    // look up a key
+    Lookup get(Key key, Value& value) {
+        if (!mayContain(key)) return Lookup::missing;
+        if (!settle(key)) return Lookup::failed;
+
+        if (!lockFile(fd, LOCK_SH)) {
+            fail("could not lock file");
+            return Lookup::failed;
+        }
+        if (!refresh()) {
+            unlockFile(fd);
+            return Lookup::failed;
+        }
+        const char* slot = format.find(data, mappedSize, key);
+        if (slot != nullptr) value = Format::load(slot);
+        unlockFile(fd);
+
+        return (slot != nullptr) ? Lookup::found : Lookup::missing;
+    }
+
+    // look up count keys under one lock, returns how many were found or -1
+    ssize_t mget(const Key* keys, size_t count, Value* values, bool* found) {
+
+        // settle what the presence filter can, and skip the lock if that is everything
+        size_t candidates = 0;
+        for (size_t i = 0; i < count; ++i) {
+            found[i] = mayContain(keys[i]);
+            if (!found[i]) continue;
+            if (!settle(keys[i])) return -1;
+            candidates++;
+        }
+        if (candidates == 0) return 0;
+
+        if (!lockFile(fd, LOCK_SH)) {
+            fail("could not lock file");
+            return -1;
+        }
+        if (!refresh()) {
+            unlockFile(fd);
+            return -1;
+        }
+        ssize_t hits = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!found[i]) continue;
+            const char* slot = format.find(data, mappedSize, keys[i]);
+            found[i] = slot != nullptr;
+            if (found[i]) {
+                values[i] = Format::load(slot);
+                hits++;
+            }
+        }
+        unlockFile(fd);
+
+        return hits;
+    }
+
+    // map key to value, returns false if the engine is read only, the key is
+    // out of range or the value could not be stored
+    bool set(Key key, Value value) {
+        if (access != Access::readWrite)
+            return fail("engine is not open for writing");
+        if (!inRange(key)) return fail("key is out of range");
+
+        // report a failure the writer ran into since the last call
+        if constexpr (Format::kAppends) {
+            if (const char* error = writer->error()) return fail(error);
+        }
+
+        // the sidecar was deleted or replaced, build or join the current one
+        if (!filter.isCurrent()) {
+            if (!lockFile(fd, LOCK_EX)) return fail("could not lock file");
+            bool loaded = refresh() && loadFilter();
+            unlockFile(fd);
+            if (!loaded) return false;
+        }
+
+        // mark the key present before it can reach the file
+        filter.insert(key);
+
+        // if an append of this key is still queued, let it land so the value
+        // is overwritten in place instead of appended twice
+        if (!settle(key)) return false;
+
+        if (!lockFile(fd, LOCK_EX)) return fail("could not lock file");
+        if (!refresh()) {
+            unlockFile(fd);
+            return false;
+        }
+        bool moved = format.tidy(data, mappedSize);
+        char* slot = format.find(data, mappedSize, key);
+
+        if (slot == nullptr) {
+            if constexpr (Format::kAppends) {
+                unlockFile(fd);
+                if (moved && durability == Durability::synced &&
+                    !syncMapped(data, data + mappedSize))
+                    return false;
+
+                // queue key value pair to be written to end of file
+                size_t checkedSize = mappedSize;
+                if (pending.isFull() && !drain()) return false;
+                pending.insert(key);
+                if (!writer->append(key, value, checkedSize, durability))
+                    return fail(writer->error());
+                return true;
+            } else {
+
+                // grow the file and make room for the key in place
+                size_t size = mappedSize;
+                if (ftruncate(fd, Format::grownSize(size, key)) != 0) {
+                    unlockFile(fd);
+                    return fail("could not grow file");
+                }
+                if (!refresh()) {
+                    unlockFile(fd);
+                    return false;
+                }
+                slot = Format::insert(data, size, key);
+                moved = true;
+            }
+        }
+
+        Format::store(slot, value);
+        unlockFile(fd);
+
+        // write the edited pages back if the caller wants them on disk,
+        // all of them if records were merged or inserted
+        if (durability != Durability::synced) return true;
+        return moved
+            ? syncMapped(data, data + mappedSize)
+            : syncMapped(slot, slot + Format::kValueBytes);
+    }
+
+    // wait for queued appends to reach the file
+    bool flush() {
+        if constexpr (Format::kAppends) {
+            if (writer == nullptr) return true;
+            if (!drain()) return false;
+
+            // leave the file tidy for readers
+            if (!lockFile(fd, LOCK_EX)) return fail("could not lock file");
+            bool tidied = refresh() && (!format.tidy(data, mappedSize) ||
+                durability != Durability::synced || syncMapped(data, data + mappedSize));
+            unlockFile(fd);
+            return tidied;
+        }
+        return true;
+    }
+
+private:
+    // filter misses answered between checks that the sidecar is current
+    static constexpr unsigned kMissesPerCheck = 256;
+
+    // layouts that never append have no writer thread
+    struct NoWriter {};
+    typedef typename std::conditional<Format::kAppends, AsyncWriter<Format>, NoWriter>::type Writer;
+
+    static bool inRange(Key key) {
+        return KeyBits >= 64 || (static_cast<uint64_t>(key) >> (KeyBits % 64)) == 0;
+    }
+
+    bool fail(const char* error) {
+        lastError = error;
+        return false;
+    }
+
+    // answer from the presence filter if possible
+    bool mayContain(Key key) {
+        if (!inRange(key)) return false;
+        if (!filter.isOpen() || filter.mayContain(key)) return true;
+
+        // trust a clear bit without a syscall, confirming only every so
+        // often that the sidecar has not been replaced
+        if (++uncheckedMisses < kMissesPerCheck) return false;
+        uncheckedMisses = 0;
+        if (filter.isCurrent()) return false;
+
+        // otherwise a reader moves to the new sidecar, and a setter searches
+        // the file until its next set rebuilds the filter
+        if (access == Access::readWrite) return true;
+        filter.close();
+        filter.openForReading();
+        return !filter.isOpen() || filter.mayContain(key);
+    }
+
+    // write pages changed through the mapping back to the disk
+    bool syncMapped(const char* begin, const char* end) {
+        uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+        char* first = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(begin) & ~(pageSize - 1));
+        if (msync(first, end - first, MS_SYNC) != 0) return fail("could not sync memory");
+#ifdef __APPLE__
+        // msync leaves the data in the drive's cache
+        if (!flushFile(fd)) return fail("could not flush file");
+#endif
+        return true;
+    }
+
+    // map the shared presence filter and mark every key in the file and
+    // every key still queued, with the file locked exclusively
+    bool loadFilter() {
+        filter.close();
+        bool loaded = filter.openForWriting([&](PresenceFilter<KeyBits>& keys) {
+            Format::forEachKey(data, mappedSize, [&](Key key) { keys.insert(key); });
+            pending.forEach([&](Key key) { keys.insert(key); });
+        });
+        return loaded || fail("could not open presence filter");
+    }
+
+    // make sure our own queued append of key is in the file
+    bool settle(Key key) {
+        if (!pending.contains(key)) return true;
+        return drain();
+    }
+
+    // wait for the writer and forget the keys it has appended
+    bool drain() {
+        if constexpr (Format::kAppends) {
+            if (!writer->drain()) return fail(writer->error());
+            pending.clear();
+        }
+        return true;
+    }
+
+    // remap the file if another process, or our writer, changed its size
+    bool refresh() {
+        size_t size = getFilesize(fd);
+        if (size == mappedSize) return true;
+
+        // a setter may have created or rebuilt the sidecar since we last
+        // looked, only worth checking once the file has changed
+        if (access == Access::readOnly && !filter.isCurrent()) {
+            filter.close();
+            filter.openForReading();
+        }
+
+        if (data != nullptr) {
+            int rc = munmap(data, mappedSize);
+            data = nullptr;
+            mappedSize = 0;
+            if (rc != 0) return fail("could not unmap memory");
+        }
+
+        if (size == 0) return true;
+
+        int protection = (access == Access::readWrite) ? PROT_READ|PROT_WRITE : PROT_READ;
+        void* mapped = mmap(NULL, size, protection, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) return fail("could not memory map file");
+
+        data = static_cast<char*>(mapped);
+        mappedSize = size;
+        format.remapped(data, mappedSize, access == Access::readWrite);
+        return true;
+    }
+
+    Access access = Access::readOnly;
+    Durability durability = Durability::written;
+    const char* lastError = nullptr;
+
+    int fd = -1;
+    char* data = nullptr;
+    size_t mappedSize = 0;
+
+    Format format;
+    PresenceFilter<KeyBits> filter;
+    unsigned uncheckedMisses = 0;       // misses answered since isCurrent()
+    PendingKeys<Key> pending;
+    std::unique_ptr<Writer> writer;
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <string>
+#include "mmapgetset.h"
+
+// directory holding every file the tests create
+std::string directory;
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool passed, const char* condition, const char* file, int line) {
+    if (passed) return;
+    std::cerr << file << ":" << line << ": failed: " << condition << std::endl;
+    failures++;
+}
+
+// create an empty data file and remove its sidecar
+std::string emptyFile(const std::string& name) {
+    std::string path = directory + "/" + name;
+    int fd = open(path.c_str(), O_CREAT|O_TRUNC|O_RDWR, 0644);
+    if (fd < 0) {
+        std::cerr << "error: could not create " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    unlink((path + ".presence").c_str());
+    return path;
+}
+
+size_t fileSize(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    size_t size = getFilesize(fd);
+    close(fd);
+    return size;
+}
+
+template <typename Engine, typename Key>
+bool has(Engine& engine, Key key, uint32_t expected) {
+    uint32_t value = 0;
+    return engine.get(key, value) == Lookup::found && value == expected;
+}
+
+template <typename Engine, typename Key>
+bool lacks(Engine& engine, Key key) {
+    uint32_t value = 0;
+    return engine.get(key, value) == Lookup::missing;
+}
+
+// set, overwrite and look up keys through a setter and a separate getter
+template <typename Engine, typename Key>
+void testBasics(const std::string& name, Durability durability) {
+    std::string path = emptyFile(name);
+
+    Engine setter;
+    CHECK(setter.open(path.c_str(), Access::readWrite, durability));
+    // out of order, so sorted setters merge their tail
+    for (Key i = 0; i < 200; ++i) {
+        Key key = (i * 37) % 200 + 1;
+        CHECK(setter.set(key * 3, key));
+    }
+    CHECK(setter.flush());
+
+    Engine getter;
+    CHECK(getter.open(path.c_str(), Access::readOnly));
+    CHECK(has(getter, Key(3), 1));
+    CHECK(has(getter, Key(600), 200));
+    CHECK(lacks(getter, Key(4)));
+
+    // overwrite in place, the file must not grow
+    size_t size = fileSize(path);
+    CHECK(setter.set(Key(300), 7777));
+    CHECK(setter.set(Key(3), 0));
+    CHECK(setter.flush());
+    CHECK(fileSize(path) == size);
+    CHECK(has(getter, Key(300), 7777));
+    CHECK(has(getter, Key(3), 0));
+    CHECK(has(setter, Key(300), 7777));
+
+    // a mix of hits and misses
+    const Key keys[] = {3, 4, 6, 601, 300, 0};
+    uint32_t values[6] = {};
+    bool found[6] = {};
+    CHECK(getter.mget(keys, 6, values, found) == 3);
+    CHECK(found[0] && values[0] == 0);
+    CHECK(!found[1]);
+    CHECK(found[2] && values[2] == 2);
+    CHECK(!found[3]);
+    CHECK(found[4] && values[4] == 7777);
+    CHECK(!found[5]);
+
+    // a setter reads back its own queued appends
+    CHECK(setter.set(Key(1000), 5));
+    CHECK(has(setter, Key(1000), 5));
+    CHECK(setter.set(Key(1000), 6));
+    CHECK(setter.flush());
+    CHECK(has(getter, Key(1000), 6));
+}
+
+// a getter answers a miss from the presence filter without waiting for
+// the lock another process holds on the data file
+template <typename Engine, typename Key>
+void testFastMiss(const std::string& name, Key present, Key absent) {
+    std::string path = emptyFile(name);
+
+    Engine setter;
+    CHECK(setter.open(path.c_str(), Access::readWrite));
+    CHECK(setter.set(present, 1));
+    CHECK(setter.flush());
+
+    Engine getter;
+    CHECK(getter.open(path.c_str(), Access::readOnly));
+    CHECK(has(getter, present, 1));
+
+    int fd = open(path.c_str(), O_RDONLY);
+    CHECK(lockFile(fd, LOCK_EX));
+    auto miss = std::async(std::launch::async, [&] { return lacks(getter, absent); });
+    bool answered = miss.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+    CHECK(answered);
+    unlockFile(fd);
+    close(fd);
+    CHECK(miss.get());
+}
+
+// keys wider than 16 bits share the Bloom filter
+template <typename Engine>
+void testWideKeys(const std::string& name) {
+    std::string path = emptyFile(name);
+
+    Engine setter;
+    CHECK(setter.open(path.c_str(), Access::readWrite, Durability::queued));
+    for (uint32_t i = 0; i < 2000; ++i) {
+        uint32_t scrambled = (i * 7919) % 2000;
+        CHECK(setter.set(0x10000u + scrambled * 0x10001u, scrambled));
+    }
+    CHECK(setter.flush());
+
+    Engine getter;
+    CHECK(getter.open(path.c_str(), Access::readOnly));
+    int misses = 0;
+    for (uint32_t i = 0; i < 2000; ++i) {
+        CHECK(has(getter, 0x10000u + i * 0x10001u, i));
+        misses += lacks(getter, 0x7fff0000u + i);
+    }
+    CHECK(misses == 2000);
+}
+
+// a setter sorts a file left unsorted by an older version
+void testResort() {
+    typedef SortedBinaryLayout<uint32_t, uint32_t>::Record Record;
+    std::string path = emptyFile("unsorted.bin");
+
+    const Record records[] = {{9, 90}, {2, 20}, {7, 70}, {4, 40}};
+    FILE* out = fopen(path.c_str(), "wb");
+    fwrite(records, sizeof(Record), 4, out);
+    fclose(out);
+
+    MmapEngine<uint32_t, uint32_t, SortedBinaryLayout, 16> setter;
+    CHECK(setter.open(path.c_str(), Access::readWrite));
+    CHECK(has(setter, 2u, 20));
+    CHECK(has(setter, 9u, 90));
+
+    Record sorted[4] = {};
+    FILE* in = fopen(path.c_str(), "rb");
+    CHECK(fread(sorted, sizeof(Record), 4, in) == 4);
+    fclose(in);
+    CHECK(sorted[0].key == 2 && sorted[1].key == 4 && sorted[2].key == 7 && sorted[3].key == 9);
+    CHECK(sorted[1].value == 40);
+}
+
+// a getter moves to a sidecar rebuilt after the old one was deleted, even
+// when the new key is set in place without the data file growing
+void testReplacedSidecar() {
+    std::string path = emptyFile("replaced.direct");
+    typedef MmapEngine<uint16_t, uint32_t, DirectLayout, 16> Engine;
+
+    Engine first;
+    CHECK(first.open(path.c_str(), Access::readWrite));
+    CHECK(first.set(100, 1));
+
+    Engine getter;
+    CHECK(getter.open(path.c_str(), Access::readOnly));
+    CHECK(lacks(getter, uint16_t(50)));
+
+    unlink((path + ".presence").c_str());
+    Engine second;
+    CHECK(second.open(path.c_str(), Access::readWrite));
+    CHECK(second.set(50, 5));
+
+    int lookups = 0;
+    while (!has(getter, uint16_t(50), 5) && lookups < 1000)
+        lookups++;
+    CHECK(lookups <= 256);
+}
+
+// a getter can not write
+void testReadOnly() {
+    std::string path = emptyFile("readonly.txt");
+    MmapEngine<uint32_t, uint32_t, TextLayout, 16> getter;
+    CHECK(getter.open(path.c_str(), Access::readOnly));
+    CHECK(!getter.set(1, 1));
+    CHECK(getter.error() != nullptr);
+}
+
+template <typename Key, template <typename, typename> class Layout>
+void testLayout(const std::string& name) {
+    typedef MmapEngine<Key, uint32_t, Layout, 16> Engine;
+    testBasics<Engine, Key>(name + ".queued", Durability::queued);
+    testBasics<Engine, Key>(name + ".written", Durability::written);
+    testBasics<Engine, Key>(name + ".synced", Durability::synced);
+    testFastMiss<Engine, Key>(name + ".miss", 5, 6);
+}
+
+int main() {
+    char temporary[] = "/tmp/mmapgetset_test.XXXXXX";
+    if (mkdtemp(temporary) == nullptr) {
+        std::cerr << "error: could not create a temporary directory" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    directory = temporary;
+
+    testLayout<uint32_t, TextLayout>("text");
+    testLayout<uint32_t, SortedBinaryLayout>("sorted");
+    testLayout<uint16_t, DirectLayout>("direct");
+
+    testWideKeys<MmapEngine<uint32_t, uint32_t, TextLayout, 32>>("text.wide");
+    testWideKeys<MmapEngine<uint32_t, uint32_t, SortedBinaryLayout, 32>>("sorted.wide");
+    testFastMiss<MmapEngine<uint32_t, uint32_t, TextLayout, 32>>("text.widemiss", 0x12345678u, 0x12345679u);
+    testFastMiss<MmapEngine<uint32_t, uint32_t, SortedBinaryLayout, 32>>("sorted.widemiss", 0x12345678u, 0x12345679u);
+
+    testResort();
+    testReplacedSidecar();
+    testReadOnly();
+
+    std::string cleanup = "rm -r " + directory;
+    if (system(cleanup.c_str()) != 0) std::cerr << "warning: could not remove " << directory << std::endl;
+
+    if (failures != 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "all tests passed" << std::endl;
+    return EXIT_SUCCESS;
+}